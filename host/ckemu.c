@@ -0,0 +1,247 @@
+/*
+ * ckemu - Cryptkeeper device emulator on a pseudo-terminal.
+ *
+ * Runs the firmware command code (src/command.c, src/sd.c, src/task.c)
+ * against the behavioural card in host/simcard.c, with the UART replaced by
+ * a pty. Each emulated unit prints its slave path; point PuTTY, screen or
+ * ckhost at it exactly as at a real board.
+ *
+ *   ckemu [-n units] [-i image] [-b blocks] [-p password] [-L] [-E erase_polls]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../include/uart.h"
+#include "../include/sd.h"
+#include "../include/clock.h"
+#include "../include/task.h"
+#include "../include/command.h"
+#include "simcard.h"
+
+#define MAX_UNITS 64
+
+
+static int uart_fd = -1;
+static volatile sig_atomic_t stopping;
+
+
+/*
+ * Firmware services the AVR modules provide on the board.
+ */
+uint8_t uart_pending_data() {
+    struct pollfd p = { uart_fd, POLLIN, 0 };
+
+    return poll(&p, 1, 0) > 0 && (p.revents & POLLIN);
+}
+
+
+void clock_init(void) {
+}
+
+
+uint32_t clock_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+
+uint32_t clock_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+
+/*
+ * uart_putchar() turns '\n' into "\r\n", do the same on the pty.
+ */
+static ssize_t uart_write(void *cookie, const char *buf, size_t len) {
+    char out[256];
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++) {
+        if (n >= sizeof(out) - 2) {
+            if (write(uart_fd, out, n) < 0) return -1;
+            n = 0;
+        }
+        if (buf[i] == '\n') out[n++] = '\r';
+        out[n++] = buf[i];
+    }
+    if (n && write(uart_fd, out, n) < 0) return -1;
+    return len;
+}
+
+
+static ssize_t uart_read(void *cookie, char *buf, size_t len) {
+    ssize_t n;
+
+    do {
+        n = read(uart_fd, buf, 1);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+
+static int open_pty(char *path, size_t len, int *slave) {
+    struct termios tio;
+    int fd;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0 || ptsname_r(fd, path, len) != 0) {
+        perror("pty");
+        return -1;
+    }
+
+    /* Hold the slave open so output queues up before a client attaches, and raw like a serial line. */
+    *slave = open(path, O_RDWR | O_NOCTTY);
+    if (*slave < 0 || tcgetattr(*slave, &tio) < 0) {
+        perror(path);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    return fd;
+}
+
+
+static void load_image(const char *path, uint8_t *image, uint32_t nblocks) {
+    FILE *f;
+    uint32_t i;
+
+    if (path) {
+        if ((f = fopen(path, "rb")) == NULL) {
+            perror(path);
+            exit(1);
+        }
+        if (fread(image, 1, nblocks * 512UL, f) == 0) fprintf(stderr, "%s: empty image\n", path);
+        fclose(f);
+        return;
+    }
+
+    /* No image: a recognisable pattern with an MBR signature on block 0. */
+    for (i = 0; i < nblocks * 512UL; i++) image[i] = (uint8_t)(i / 512 + i % 512);
+    image[510] = 0x55;
+    image[511] = 0xaa;
+}
+
+
+/*
+ * One emulated board: the firmware main loop with the pty as its UART.
+ */
+static void run_unit(int fd, struct simcard *card) {
+    cookie_io_functions_t rx = { uart_read, NULL, NULL, NULL };
+    cookie_io_functions_t tx = { NULL, uart_write, NULL, NULL };
+
+    /* Unbuffered both ways so uart_pending_data() sees every byte getchar() has not taken. */
+    uart_fd = fd;
+    stdin  = fopencookie(NULL, "r", rx);
+    stdout = fopencookie(NULL, "w", tx);
+    setvbuf(stdin, NULL, _IONBF, 0);
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    simcard_attach(card);
+    clock_init();
+    ShowMenu();
+
+    while (1) {
+        task_run();
+        ProcessCommand();
+    }
+}
+
+
+static void on_signal(int sig) {
+    stopping = 1;
+}
+
+
+static void usage(void) {
+    fprintf(stderr, "usage: ckemu [-n units] [-i image] [-b blocks] [-p password] [-L] [-E erase_polls]\n");
+    exit(2);
+}
+
+
+int main(int argc, char **argv) {
+    struct simcard card;
+    const char    *image_path = NULL, *password = NULL;
+    uint32_t       nblocks = 2048;
+    uint8_t       *image;
+    int            opt, units = 1, lock = 0, i;
+    unsigned long  erase_polls = 20000;
+    char          *end;
+    int            fds[MAX_UNITS], slaves[MAX_UNITS];
+    char           path[64];
+    pid_t          pids[MAX_UNITS];
+    struct sigaction sa;
+
+    while ((opt = getopt(argc, argv, "n:i:b:p:LE:")) != -1) {
+        switch (opt) {
+            case 'n' : units = atoi(optarg); break;
+            case 'i' : image_path = optarg; break;
+            case 'b' : nblocks = strtoul(optarg, NULL, 0); break;
+            case 'p' : password = optarg; break;
+            case 'L' : lock = 1; break;
+            case 'E' :
+                errno = 0;
+                erase_polls = strtoul(optarg, &end, 0);
+                if (errno || *end || optarg[0] == '-' || erase_polls > UINT32_MAX) usage();
+                break;
+            default  : usage();
+        }
+    }
+    if (units < 1 || units > MAX_UNITS || nblocks == 0 || (lock && !password)) usage();
+    if (password && strlen(password) > sizeof(card.pwd)) {
+        fprintf(stderr, "password longer than %zu bytes\n", sizeof(card.pwd));
+        return 2;
+    }
+
+    for (i = 0; i < units; i++) {
+        if ((fds[i] = open_pty(path, sizeof(path), &slaves[i])) < 0) return 1;
+        printf("%s\n", path);
+    }
+    fflush(stdout);
+
+    for (i = 0; i < units; i++) {
+        if ((pids[i] = fork()) == 0) {
+            if ((image = calloc(nblocks, 512)) == NULL) _exit(1);
+            load_image(image_path, image, nblocks);
+
+            simcard_model(&card, image, nblocks);
+            card.erase_busy = erase_polls;
+            if (password) {
+                card.pwd_len = strlen(password);
+                memcpy(card.pwd, password, card.pwd_len);
+                card.locked = lock;
+            }
+            run_unit(fds[i], &card);
+            _exit(0);
+        }
+        if (pids[i] < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+
+    /* Units run until interrupted; take them down together. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    while (!stopping && wait(NULL) < 0 && errno == EINTR);
+    for (i = 0; i < units; i++) kill(pids[i], SIGTERM);
+    while (wait(NULL) > 0);
+    return 0;
+}
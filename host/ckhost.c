@@ -0,0 +1,434 @@
+/*
+ * ckhost - drive many Cryptkeeper units from one workstation.
+ *
+ * Opens every serial port given and runs the same job list on all of them
+ * in parallel, non-blocking, from a single epoll loop. Jobs map onto the
+ * terminal commands: dump (r), verify (?), lock (l) and unlock (u). Each
+ * command is complete when the device prints its prompt. Reports per
+ * device results, timings and throughput.
+ *
+ *   ckhost [-j jobs] [-p password] [-o dir] [-r repeat] [-t timeout_s] [-g gap_ms] port...
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "../include/command.h"
+
+#define MAX_DEVICES   64
+#define MAX_JOBS      32
+#define RX_MAX        8192
+#define SYNC_MS       4000    // wait this long for the menu prompt after opening
+#define SETTLE_MS     200     // ProcessCommand() needs an idle pass between keys
+#define PWD_MAX       16      // pwd[] in src/sd.c, the firmware does not bound the entry
+
+enum job { JOB_DUMP, JOB_VERIFY, JOB_LOCK, JOB_UNLOCK };
+static const char *job_names[] = { "dump", "verify", "lock", "unlock" };
+static const char  job_keys[]  = { 'r', '?', 'l', 'u' };
+
+enum dev_state { DEV_SYNC, DEV_SETTLE, DEV_CMD, DEV_DONE };
+
+struct result {
+    enum job  job;
+    int       ok;
+    double    ms;
+    char      note[48];
+};
+
+struct device {
+    const char     *path;
+    int             fd;
+    enum dev_state  state;
+    int             want_out;
+
+    char            rx[RX_MAX + 1];
+    size_t          nrx;
+    char            tx[64];
+    size_t          ntx, txpos;
+    double          next_tx;
+    double          deadline;
+
+    int             step;           // index into the repeated job list
+    int             pwd_sent;
+    int             expect_locked;  // -1 unknown
+    double          job_start, start, end;
+    unsigned long   rx_bytes, tx_bytes, dumped;
+
+    struct result  *results;
+    uint8_t         block[512];
+};
+
+static enum job     jobs[MAX_JOBS];
+static int          njobs, repeat = 1;
+static const char  *password, *outdir;
+static double       timeout_ms = 30000, gap_ms = 5;
+static int          epfd;
+
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+static int open_port(const char *path) {
+    struct termios tio;
+    int fd;
+
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0 || tcgetattr(fd, &tio) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B38400);
+    cfsetospeed(&tio, B38400);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &tio);
+    return fd;
+}
+
+
+static void watch(struct device *dev, int out) {
+    struct epoll_event ev = { EPOLLIN | (out ? EPOLLOUT : 0), { .ptr = dev } };
+
+    dev->want_out = out;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, dev->fd, &ev);
+}
+
+
+static void queue(struct device *dev, const char *s, size_t len) {
+    if (dev->ntx + len > sizeof(dev->tx)) len = sizeof(dev->tx) - dev->ntx;
+    memcpy(dev->tx + dev->ntx, s, len);
+    dev->ntx += len;
+}
+
+
+/*
+ * Paced writer: one byte per gap, the firmware reads the UART by polling.
+ */
+static void flush_tx(struct device *dev, double now) {
+    ssize_t n;
+
+    if (dev->want_out || dev->txpos == dev->ntx || now < dev->next_tx) return;
+
+    n = write(dev->fd, dev->tx + dev->txpos, 1);
+    if (n == 1) {
+        dev->txpos++;
+        dev->tx_bytes++;
+        dev->next_tx = now + gap_ms;
+        if (dev->txpos == dev->ntx) dev->txpos = dev->ntx = 0;
+    } else if (n < 0 && errno == EAGAIN) watch(dev, 1);
+}
+
+
+static void start_job(struct device *dev, double now) {
+    char key = job_keys[jobs[dev->step % njobs]];
+
+    dev->nrx       = 0;
+    dev->pwd_sent  = 0;
+    dev->job_start = now;
+    dev->deadline  = now + timeout_ms;
+    dev->state     = DEV_CMD;
+    queue(dev, &key, 1);
+}
+
+
+/*
+ * Pull the 512 byte block back out of DisplayBlock() output.
+ */
+static int parse_dump(struct device *dev) {
+    char *line, *save = NULL;
+    unsigned off, b, k, got = 0;
+    int n;
+
+    for (line = strtok_r(dev->rx, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        if (strlen(line) < 6 || line[4] != ':' || sscanf(line, "%4x:", &off) != 1 || off > 512 - 16) continue;
+        line += 5;
+        for (k = 0; k < 16 && sscanf(line, " %2x%n", &b, &n) == 1; k++, line += n) dev->block[off + k] = b;
+        got += k;
+    }
+    return got == 512;
+}
+
+
+static void save_dump(struct device *dev) {
+    char name[256], *p;
+    FILE *f;
+
+    snprintf(name, sizeof(name), "%s/%s.bin", outdir,
+             strncmp(dev->path, "/dev/", 5) == 0 ? dev->path + 5 : dev->path);
+    for (p = name + strlen(outdir) + 1; *p; p++) if (*p == '/') *p = '_';
+
+    if ((f = fopen(name, "wb")) == NULL || fwrite(dev->block, 1, 512, f) != 512) perror(name);
+    if (f) fclose(f);
+}
+
+
+/*
+ * Judge a finished command from what the device printed.
+ */
+static void finish_job(struct device *dev, double now, int timed_out) {
+    struct result *r = &dev->results[dev->step];
+    const char *rx = dev->rx;
+    int locked;
+
+    r->job = jobs[dev->step % njobs];
+    r->ms  = now - dev->job_start;
+    r->ok  = 0;
+
+    if (timed_out) snprintf(r->note, sizeof(r->note), "timed out");
+    else if (strstr(rx, "Card busy")) snprintf(r->note, sizeof(r->note), "card busy");
+    else if (strstr(rx, "Unable to initialize")) snprintf(r->note, sizeof(r->note), "no card");
+    else switch (r->job) {
+        case JOB_DUMP :
+            if (parse_dump(dev)) {
+                r->ok = 1;
+                dev->dumped += 512;
+                if (outdir) save_dump(dev);
+                snprintf(r->note, sizeof(r->note), "512 B, %.0f B/s", 512 * 1000.0 / r->ms);
+            } else snprintf(r->note, sizeof(r->note), "block read failed");
+            break;
+
+        case JOB_VERIFY :
+            if (strstr(rx, "Status: Locked")) locked = 1;
+            else if (strstr(rx, "Status: Unlocked")) locked = 0;
+            else {
+                snprintf(r->note, sizeof(r->note), "registers unreadable");
+                break;
+            }
+            r->ok = dev->expect_locked < 0 || dev->expect_locked == locked;
+            snprintf(r->note, sizeof(r->note), "%s%s", locked ? "locked" : "unlocked",
+                     r->ok ? "" : ", expected otherwise");
+            break;
+
+        case JOB_LOCK :
+        case JOB_UNLOCK :
+            if (strstr(rx, "done.") || strstr(rx, r->job == JOB_LOCK ? "already locked" : "already unlocked")) {
+                r->ok = 1;
+                dev->expect_locked = r->job == JOB_LOCK;
+                snprintf(r->note, sizeof(r->note), "%s", strstr(rx, "already") ? "already" : "done");
+            } else snprintf(r->note, sizeof(r->note), "failed");
+            break;
+    }
+
+    dev->step++;
+    if (dev->step == njobs * repeat) {
+        dev->state = DEV_DONE;
+        dev->end   = now;
+    } else {
+        dev->state    = DEV_SETTLE;
+        dev->deadline = now + SETTLE_MS;
+    }
+}
+
+
+static void on_readable(struct device *dev, double now) {
+    ssize_t n;
+
+    for (;;) {
+        if (dev->nrx == RX_MAX) {
+            /* Keep the tail, that is where the prompt and results are. */
+            memmove(dev->rx, dev->rx + RX_MAX / 2, RX_MAX / 2);
+            dev->nrx = RX_MAX / 2;
+        }
+        n = read(dev->fd, dev->rx + dev->nrx, RX_MAX - dev->nrx);
+        if (n <= 0) break;
+        dev->nrx      += n;
+        dev->rx_bytes += n;
+    }
+    dev->rx[dev->nrx] = 0;
+
+    switch (dev->state) {
+        case DEV_SYNC :
+            if (strstr(dev->rx, COMMAND_PROMPT)) start_job(dev, now);
+            break;
+        case DEV_CMD :
+            if (!dev->pwd_sent && password && strstr(dev->rx, "Password:")) {
+                queue(dev, password, strlen(password));
+                queue(dev, "\r", 1);
+                dev->pwd_sent = 1;
+            }
+            if (strstr(dev->rx, COMMAND_PROMPT)) finish_job(dev, now, 0);
+            break;
+        default :
+            break;
+    }
+}
+
+
+static void on_tick(struct device *dev, double now) {
+    flush_tx(dev, now);
+    if (now < dev->deadline) return;
+
+    switch (dev->state) {
+        case DEV_SYNC :     // No menu seen, the board may not reset on open. Go anyway.
+        case DEV_SETTLE :
+            start_job(dev, now);
+            break;
+        case DEV_CMD :
+            finish_job(dev, now, 1);
+            break;
+        default :
+            break;
+    }
+}
+
+
+static int parse_jobs(const char *list) {
+    char buf[256], *tok, *save = NULL;
+    int i;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < 4 && strcmp(tok, job_names[i]) != 0; i++);
+        if (i == 4 || njobs == MAX_JOBS) {
+            fprintf(stderr, "unknown job '%s'\n", tok);
+            return -1;
+        }
+        jobs[njobs++] = i;
+        if ((i == JOB_LOCK || i == JOB_UNLOCK) && !password) {
+            fprintf(stderr, "%s needs -p password\n", tok);
+            return -1;
+        }
+    }
+    return njobs ? 0 : -1;
+}
+
+
+static void report(struct device *devs, int ndev, double wall) {
+    unsigned long rx = 0, dumped = 0;
+    int d, s, ok, failures = 0;
+
+    printf("%-16s %-7s %-6s %9s  %s\n", "device", "job", "result", "time", "note");
+    for (d = 0; d < ndev; d++) {
+        for (s = 0; s < devs[d].step; s++) {
+            struct result *r = &devs[d].results[s];
+
+            printf("%-16s %-7s %-6s %7.0fms  %s\n", devs[d].path, job_names[r->job],
+                   r->ok ? "ok" : "FAIL", r->ms, r->note);
+            if (!r->ok) failures++;
+        }
+    }
+
+    printf("\n%-16s %6s %9s %9s %9s %10s\n", "device", "ok", "time", "rx", "rx B/s", "dump B/s");
+    for (d = 0; d < ndev; d++) {
+        struct device *dev = &devs[d];
+        double secs = (dev->end - dev->start) / 1e3;
+
+        for (s = 0, ok = 0; s < dev->step; s++) ok += dev->results[s].ok;
+        printf("%-16s %3d/%-2d %8.2fs %9lu %9.0f %10.0f\n", dev->path, ok, njobs * repeat, secs,
+               dev->rx_bytes, secs > 0 ? dev->rx_bytes / secs : 0, secs > 0 ? dev->dumped / secs : 0);
+        rx     += dev->rx_bytes;
+        dumped += dev->dumped;
+    }
+
+    printf("\n%d device(s), %d job(s) each, %d failure(s) in %.2fs, %.0f rx B/s, %.0f dump B/s aggregate\n",
+           ndev, njobs * repeat, failures, wall / 1e3, rx * 1e3 / wall, dumped * 1e3 / wall);
+}
+
+
+static void usage(void) {
+    fprintf(stderr, "usage: ckhost [-j dump,verify,lock,unlock] [-p password] [-o dir] [-r repeat]\n"
+                    "              [-t timeout_s] [-g gap_ms] port...\n");
+    exit(2);
+}
+
+
+int main(int argc, char **argv) {
+    static struct device devs[MAX_DEVICES];
+    struct epoll_event   events[MAX_DEVICES], ev;
+    const char          *joblist = "verify,dump";
+    double               now, start, next;
+    int                  opt, ndev, d, n, i, running, failures = 0;
+
+    while ((opt = getopt(argc, argv, "j:p:o:r:t:g:")) != -1) {
+        switch (opt) {
+            case 'j' : joblist = optarg; break;
+            case 'p' : password = optarg; break;
+            case 'o' : outdir = optarg; break;
+            case 'r' : repeat = atoi(optarg); break;
+            case 't' : timeout_ms = atof(optarg) * 1e3; break;
+            case 'g' : gap_ms = atof(optarg); break;
+            default  : usage();
+        }
+    }
+    ndev = argc - optind;
+    if (ndev < 1 || ndev > MAX_DEVICES || repeat < 1 || parse_jobs(joblist) != 0) usage();
+    if (password && strlen(password) > PWD_MAX) {
+        fprintf(stderr, "password longer than %d bytes\n", PWD_MAX);
+        return 2;
+    }
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    start = now_ms();
+    for (d = 0; d < ndev; d++) {
+        struct device *dev = &devs[d];
+
+        dev->path          = argv[optind + d];
+        dev->expect_locked = -1;
+        dev->results       = calloc(njobs * repeat, sizeof(*dev->results));
+        dev->start         = start;
+        dev->deadline      = start + SYNC_MS;
+        if ((dev->fd = open_port(dev->path)) < 0) return 1;
+
+        ev.events   = EPOLLIN;
+        ev.data.ptr = dev;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, dev->fd, &ev);
+    }
+
+    for (running = ndev; running; ) {
+        /* Sleep until the nearest byte to send or deadline, or until input. */
+        now  = now_ms();
+        next = now + 1000;
+        for (d = 0; d < ndev; d++) {
+            if (devs[d].state == DEV_DONE) continue;
+            if (devs[d].deadline < next) next = devs[d].deadline;
+            if (devs[d].ntx && !devs[d].want_out && devs[d].next_tx < next) next = devs[d].next_tx;
+        }
+
+        n = epoll_wait(epfd, events, MAX_DEVICES, next > now ? (int)(next - now) + 1 : 0);
+        now = now_ms();
+
+        for (i = 0; i < n; i++) {
+            struct device *dev = events[i].data.ptr;
+
+            if (events[i].events & EPOLLOUT) watch(dev, 0);
+            if (events[i].events & EPOLLIN) on_readable(dev, now);
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) && dev->state != DEV_DONE) {
+                fprintf(stderr, "%s: port closed\n", dev->path);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+                dev->state = DEV_DONE;
+                dev->end   = now;
+                failures++;
+            }
+        }
+
+        for (d = 0, running = 0; d < ndev; d++) {
+            if (devs[d].state == DEV_DONE) continue;
+            on_tick(&devs[d], now);
+            if (devs[d].state != DEV_DONE) running++;
+        }
+    }
+
+    report(devs, ndev, now_ms() - start);
+
+    for (d = 0; d < ndev; d++) {
+        for (i = 0; i < devs[d].step; i++) if (!devs[d].results[i].ok) failures++;
+        close(devs[d].fd);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _SDLOCKER_HOST_IO_
+#define _SDLOCKER_HOST_IO_
+
+/*
+ * Host stand-in for modules that only pull <avr/io.h> in for its types.
+ */
+#include <stdint.h>
+
+#endif /* _SDLOCKER_HOST_IO_ */
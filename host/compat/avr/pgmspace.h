@@ -0,0 +1,15 @@
+#ifndef _SDLOCKER_HOST_PGMSPACE_
+#define _SDLOCKER_HOST_PGMSPACE_
+
+/*
+ * Host stand-in so src/sd.c builds unchanged with gcc. Flash strings are
+ * ordinary strings off the AVR.
+ */
+#include <stdio.h>
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define printf_P            printf
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+
+#endif /* _SDLOCKER_HOST_PGMSPACE_ */
@@ -0,0 +1,11 @@
+#ifndef _SDLOCKER_HOST_DELAY_
+#define _SDLOCKER_HOST_DELAY_
+
+#include <time.h>
+
+static inline void _delay_ms(double ms) {
+    struct timespec ts = { (time_t)(ms / 1000), (long)((ms - (time_t)(ms / 1000) * 1000) * 1e6) };
+    nanosleep(&ts, NULL);
+}
+
+#endif /* _SDLOCKER_HOST_DELAY_ */
@@ -0,0 +1,381 @@
+#include <string.h>
+#include <time.h>
+#include "../include/sd.h"
+#include "simcard.h"
+
+
+static struct simcard *bus;
+
+static const uint8_t model_csd[16] = {
+    0x40, 0x0e, 0x00, 0x32, 0x5b, 0x59, 0x00, 0x00,
+    0x1d, 0x8a, 0x7f, 0x80, 0x0a, 0x40, 0x00, 0x8b
+};
+static const uint8_t model_cid[16] = {
+    0x43, 0x4b, 0x53, 'E', 'M', 'U', 'L', '1',
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x01, 0x5a, 0x01
+};
+
+
+void simcard_init(struct simcard *card, const struct sim_step *steps, size_t nsteps) {
+    memset(card, 0, sizeof(*card));
+    card->steps  = steps;
+    card->nsteps = nsteps;
+    card->phase  = SIM_IDLE;
+}
+
+
+/*
+ * Behavioural card over a caller owned image, unlocked, no password.
+ */
+void simcard_model(struct simcard *card, uint8_t *image, uint32_t nblocks) {
+    simcard_init(card, NULL, 0);
+    card->image      = image;
+    card->nblocks    = nblocks;
+    card->cmd42_busy = 200;
+    card->erase_busy = 20000;
+}
+
+
+/*
+ * Route Select(), Deselect() and SendByte() to this card.
+ */
+void simcard_attach(struct simcard *card) {
+    bus = card;
+}
+
+
+/*
+ * Behavioural answer for a decoded command.
+ */
+static void model_command(struct simcard *card, uint8_t cmd, uint32_t arg) {
+    uint8_t idle = card->ready ? 0x00 : 0x01;
+
+    card->cur.cmd   = cmd;
+    card->cur.arg   = arg;
+    card->cur.r1    = idle;
+    card->cur.polls = 2;
+    card->cur.busy  = 0;
+    card->out       = NULL;
+
+    switch (cmd) {
+        case SD_IDLE :
+            card->ready   = 0;
+            card->cur.r1  = 0x01;
+            break;
+        case SD_INIT :
+        case SD_ADV_INIT :
+            card->ready   = 1;    // Idle on the first try, ready on the next
+            break;
+        case SD_CSD :
+            card->out      = model_csd;
+            card->cur.busy = 3;
+            break;
+        case SD_CID :
+            card->out      = model_cid;
+            card->cur.busy = 3;
+            break;
+        case SD_READ_BLK :
+            if (card->locked) card->cur.r1 = 0x04;
+            else if (arg >= card->nblocks) card->cur.r1 = 0x40;
+            else {
+                card->out      = card->image + arg * 512;
+                card->cur.busy = 4;
+            }
+            break;
+        case SD_INTER :
+        case SD_OCR :
+        case SD_STATUS :
+        case SD_SET_BLK :
+        case SD_LOCK_UNLOCK :
+        case CMD55 :
+            break;
+        default :
+            card->cur.r1 = 0x04;
+    }
+}
+
+
+/*
+ * Apply a received CMD42 block: mask, length, password. Sets the busy time.
+ */
+static void model_cmd42(struct simcard *card) {
+    uint8_t mask = card->in[0];
+    uint8_t len  = card->in[1];
+    const uint8_t *pwd = &card->in[2];
+    int match;
+
+    card->cur.busy = card->cmd42_busy;
+
+    if (mask & MASK_ERASE) {
+        card->cur.busy = card->erase_busy;
+        if (!card->locked) {
+            card->lock_failed = 1;
+            return;
+        }
+        memset(card->image, 0, card->nblocks * 512);
+        card->pwd_len = 0;
+        card->locked  = 0;
+        return;
+    }
+
+    if (len > sizeof(card->pwd)) {
+        card->lock_failed = 1;
+        return;
+    }
+    match = (len == card->pwd_len && memcmp(pwd, card->pwd, len) == 0);
+
+    if (mask & MASK_SET_PWD) {
+        // Replacing a password needs old and new in one block, the firmware never sends that.
+        if (card->pwd_len == 0) {
+            memcpy(card->pwd, pwd, len);
+            card->pwd_len = len;
+        } else if (!match) card->lock_failed = 1;
+        if ((mask & MASK_LOCK_UNLOCK) && card->pwd_len) card->locked = 1;
+        return;
+    }
+
+    if (mask & MASK_CLR_PWD) {
+        if (match && card->pwd_len) {
+            card->pwd_len = 0;
+            card->locked  = 0;
+        } else card->lock_failed = 1;
+        return;
+    }
+
+    if (!match || card->pwd_len == 0) {
+        card->lock_failed = 1;
+        return;
+    }
+    card->locked = (mask & MASK_LOCK_UNLOCK) ? 1 : 0;
+}
+
+
+/*
+ * Take the next profile step for a decoded command. Off script, skip ahead
+ * to the next step for this command so one mismatch does not derail the
+ * rest; with none left it is answered as an illegal command so the caller
+ * never spins forever.
+ */
+static void next_step(struct simcard *card, uint8_t cmd, uint32_t arg) {
+    const struct sim_step *s = NULL;
+    size_t i;
+
+    if (card->steps == NULL) {
+        model_command(card, cmd, arg);
+        return;
+    }
+    if (cmd == CMD55 && card->pos < card->nsteps && (card->steps[card->pos].cmd & 0x80)) {
+        // A wrapped ring can start with an ACMD whose CMD55 was overwritten.
+        card->cur.cmd   = cmd;
+        card->cur.arg   = arg;
+        card->cur.r1    = card->steps[card->pos].r1 & 0x01;
+        card->cur.polls = 1;
+        card->cur.busy  = 0;
+        return;
+    }
+    for (i = card->pos; i < card->nsteps; i++) {
+        if (card->steps[i].cmd == cmd) {
+            s = &card->steps[i];
+            break;
+        }
+    }
+
+    if (s) {
+        if (i != card->pos) card->mismatches++;
+        card->cur = *s;
+        card->pos = i + 1;
+    } else {
+        card->mismatches++;
+        card->cur.cmd   = cmd;
+        card->cur.arg   = arg;
+        card->cur.r1    = 0x04;
+        card->cur.polls = 1;
+        card->cur.busy  = 0;
+    }
+    if (card->cur.polls == 0) card->cur.polls = 1;
+}
+
+
+/*
+ * Pick the phase that follows R1 for the command in flight.
+ */
+static void after_r1(struct simcard *card) {
+    uint8_t cmd = card->cur.cmd & 0x7f;
+
+    card->phase = SIM_IDLE;
+    if (card->cur.r1 & 0xfe) return;    // error bits set, nothing follows
+
+    switch (cmd) {
+        case SD_INTER :
+        case SD_OCR :
+            card->phase = SIM_TRAIL;
+            card->left  = 4;
+            break;
+        case SD_STATUS :
+            card->phase = SIM_TRAIL;
+            card->left  = 1;
+            break;
+        case SD_CSD :
+        case SD_CID :
+            card->block_len = 16 + 2;
+            if (card->cur.busy) {
+                card->phase = SIM_TOKEN;
+                card->left  = card->cur.busy;
+            }
+            break;
+        case SD_READ_BLK :
+            card->block_len = 512 + 2;
+            if (card->cur.busy) {
+                card->phase = SIM_TOKEN;
+                card->left  = card->cur.busy;
+            }
+            break;
+        case SD_LOCK_UNLOCK :
+            // Token, mask, length, 512 password/pad bytes and CRC, as ExecuteCMD42() sends them.
+            card->phase     = SIM_WRITE;
+            card->left      = 0;
+            card->block_len = 2 + 512 + 2;
+            break;
+        default :
+            break;
+    }
+}
+
+
+static uint8_t trail_byte(struct simcard *card) {
+    static const uint8_t r7[4] = { 0x00, 0x00, 0x01, 0xaa };
+    static const uint8_t r3[4] = { 0xc0, 0xff, 0x80, 0x00 };
+    uint8_t status;
+
+    if (card->cur.cmd == SD_STATUS && card->steps == NULL) {
+        // R2 second byte: card locked, lock/unlock failed. Failure clears on read.
+        status = card->locked | (card->lock_failed << 1);
+        card->lock_failed = 0;
+        return status;
+    }
+
+    switch (card->cur.cmd) {
+        case SD_INTER : return r7[4 - card->left];
+        case SD_OCR :   return r3[4 - card->left];
+        default :       return 0x00;
+    }
+}
+
+
+uint8_t simcard_xfer(struct simcard *card, uint8_t mosi) {
+    uint8_t miso = 0xff;
+    uint8_t cmd;
+    uint32_t arg, i;
+
+    card->bytes++;
+    if (card->realtime) {
+        card->owed_us += card->us_per_byte;
+        if (card->owed_us >= 1000.0) {
+            struct timespec ts = { 0, (long)(card->owed_us * 1000.0) };
+            nanosleep(&ts, NULL);
+            card->owed_us = 0.0;
+        }
+    }
+
+    if (!card->selected) return 0xff;
+
+    switch (card->phase) {
+        case SIM_IDLE :
+            if ((mosi & 0xc0) == 0x40) {
+                card->frame[0] = mosi;
+                card->nframe   = 1;
+                card->phase    = SIM_FRAME;
+            }
+            break;
+
+        case SIM_FRAME :
+            card->frame[card->nframe++] = mosi;
+            if (card->nframe < 6) break;
+
+            cmd = card->frame[0];
+            arg = ((uint32_t)card->frame[1] << 24) | ((uint32_t)card->frame[2] << 16) |
+                  ((uint32_t)card->frame[3] << 8)  |  (uint32_t)card->frame[4];
+            if (card->after_cmd55) cmd |= 0x80;
+            card->after_cmd55 = (cmd == CMD55);
+
+            next_step(card, cmd, arg);
+            card->phase = SIM_R1;
+            card->left  = card->cur.polls;
+            break;
+
+        case SIM_R1 :
+            if (--card->left) break;
+            miso = card->cur.r1;
+            after_r1(card);
+            break;
+
+        case SIM_TRAIL :
+            miso = trail_byte(card);
+            if (--card->left == 0) card->phase = SIM_IDLE;
+            break;
+
+        case SIM_TOKEN :
+            if (--card->left) break;
+            miso = 0xfe;
+            card->phase = SIM_DATA;
+            card->left  = card->block_len;
+            break;
+
+        case SIM_DATA :
+            i = card->block_len - card->left;
+            miso = (card->out && i < card->block_len - 2) ? card->out[i] : 0x00;
+            if (--card->left == 0) card->phase = SIM_IDLE;
+            break;
+
+        case SIM_WRITE :
+            if (card->left == 0) {
+                if (mosi == 0xfe) {
+                    card->left = card->block_len;
+                    card->nin  = 0;
+                }
+                break;
+            }
+            // A force erase block is only the mask byte and CRC.
+            if (card->left == card->block_len && (mosi & MASK_ERASE)) card->left = 1 + 2;
+            if (card->nin < sizeof(card->in)) card->in[card->nin++] = mosi;
+            if (--card->left) break;
+            if (card->steps == NULL) model_cmd42(card);
+            card->phase = SIM_RESP;
+            break;
+
+        case SIM_RESP :
+            miso = 0x05;    // data accepted
+            card->phase = card->cur.busy ? SIM_BUSY : SIM_IDLE;
+            card->left  = card->cur.busy;
+            break;
+
+        case SIM_BUSY :
+            if (--card->left == 0) {
+                card->phase = SIM_IDLE;
+                break;
+            }
+            miso = 0x00;
+            break;
+    }
+
+    return miso;
+}
+
+
+/*
+ * Bus primitives for src/sd.c.
+ */
+void Select(void) {
+    bus->selected = 1;
+}
+
+
+void Deselect(void) {
+    bus->selected = 0;
+    bus->phase    = SIM_IDLE;
+}
+
+
+uint8_t SendByte(uint8_t c) {
+    return simcard_xfer(bus, c);
+}
@@ -0,0 +1,79 @@
+#ifndef _SDLOCKER_SIMCARD_
+#define _SDLOCKER_SIMCARD_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Simulated SD card on the SPI bus, byte by byte. src/sd.c drives it
+ * through Select(), Deselect() and SendByte(), exactly as it drives the
+ * real card.
+ *
+ * With a profile the card plays back a trace: for each command it holds
+ * MISO at 0xFF for the recorded number of polls before answering, and
+ * stretches data token and busy phases the same way. Without one it is a
+ * behavioural SDHC model with a block image and CMD42 password state.
+ */
+
+struct sim_step {
+    uint8_t  cmd;       // SD_* value, high bit set for ACMDs
+    uint32_t arg;
+    uint8_t  r1;
+    uint16_t polls;     // SendByte() calls up to and including R1
+    uint32_t busy;      // SendByte() calls in the data token / busy wait
+};
+
+enum sim_phase {
+    SIM_IDLE,           // waiting for a command byte
+    SIM_FRAME,          // collecting argument and CRC
+    SIM_R1,             // 0xFF until R1
+    SIM_TRAIL,          // R3/R7/R2 bytes after R1
+    SIM_TOKEN,          // 0xFF until the 0xFE data token
+    SIM_DATA,           // data block going out
+    SIM_WRITE,          // CMD42 block coming in
+    SIM_RESP,           // data response token for the CMD42 block
+    SIM_BUSY            // 0x00 while programming
+};
+
+struct simcard {
+    const struct sim_step *steps;
+    size_t          nsteps;
+    size_t          pos;
+
+    int             selected;
+    enum sim_phase  phase;
+    uint8_t         frame[6];
+    uint8_t         nframe;
+    uint8_t         after_cmd55;
+    struct sim_step cur;
+    uint32_t        left;       // bytes left in the current phase
+    uint32_t        block_len;  // data bytes to move once the token is through
+
+    unsigned long   bytes;      // total SendByte() calls
+    unsigned long   mismatches; // commands that did not match the profile
+
+    /* Behavioural model, used when there is no profile. */
+    uint8_t        *image;      // nblocks * 512 bytes of card contents
+    uint32_t        nblocks;
+    uint8_t         pwd[16];
+    uint8_t         pwd_len;
+    uint8_t         locked;
+    uint8_t         lock_failed;
+    uint8_t         ready;      // ACMD41 has completed
+    uint16_t        cmd42_busy; // busy polls after CMD42
+    uint32_t        erase_busy; // busy polls after a force erase, minutes on a real card
+    const uint8_t  *out;        // data block going out, NULL for zeros
+    uint8_t         in[2 + 512 + 2];
+    uint16_t        nin;
+
+    double          us_per_byte;
+    int             realtime;   // sleep to match the bus speed
+    double          owed_us;
+};
+
+extern void    simcard_init(struct simcard *card, const struct sim_step *steps, size_t nsteps);
+extern void    simcard_model(struct simcard *card, uint8_t *image, uint32_t nblocks);
+extern void    simcard_attach(struct simcard *card);
+extern uint8_t simcard_xfer(struct simcard *card, uint8_t mosi);
+
+#endif /* _SDLOCKER_SIMCARD_ */
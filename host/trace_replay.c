@@ -0,0 +1,314 @@
+/*
+ * trace_replay - replay a Cryptkeeper SPI trace against a simulated card.
+ *
+ * Reads the output of the 't' command (see include/trace.h), builds a
+ * timing profile from it and drives src/sd.c against host/simcard.c with
+ * the same command sequence. Reports per command captured time against
+ * modelled bus time, and can compare against a baseline capture.
+ *
+ *   trace_replay [-q] [-r] [-n runs] [-d spi_div] [-c baseline] [-t pct] trace.txt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/sd.h"
+#include "../include/trace.h"
+#include "simcard.h"
+
+
+struct capture {
+    struct sim_step *steps;
+    uint32_t        *dur_us;
+    size_t           n, cap;
+    unsigned long    f_cpu;
+    unsigned         spi_div;
+    unsigned         lost;
+};
+
+struct stat_row {
+    unsigned long count;
+    double        captured_us;
+    double        captured_max;
+    double        modelled_us;
+    unsigned long polls;
+    unsigned long busy;
+};
+
+
+/*
+ * SPI clock divider from SPCR/SPSR: SPR1:SPR0 select 4/16/64/128, SPI2X halves it.
+ */
+static unsigned spi_divider(unsigned spcr, unsigned spsr) {
+    static const unsigned div[4] = { 4, 16, 64, 128 };
+    unsigned d = div[spcr & 0x03];
+
+    return (spsr & 0x01) ? d / 2 : d;
+}
+
+
+static int load_capture(const char *path, struct capture *c) {
+    FILE *f;
+    char line[160];
+    unsigned version, spcr, spsr, count, lost;
+    unsigned long f_cpu, start, dur;
+    unsigned cmd, r1, polls;
+    unsigned long arg, busy;
+
+    memset(c, 0, sizeof(*c));
+    c->f_cpu   = 8000000UL;
+    c->spi_div = 128;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    /* Terminal logs carry menus and echoes around the dump; skip them. */
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "TRACE %u %lu %x %x %u %u", &version, &f_cpu, &spcr, &spsr, &count, &lost) == 6) {
+            /* Version 1 only had a 16 bit busy count, the line format is the same. */
+            if (version < 1 || version > TRACE_VERSION) {
+                fprintf(stderr, "%s: trace version %u, expected up to %u\n", path, version, TRACE_VERSION);
+                fclose(f);
+                return -1;
+            }
+            c->f_cpu   = f_cpu;
+            c->spi_div = spi_divider(spcr, spsr);
+            c->lost   += lost;
+        } else if (sscanf(line, "E %lu %x %lx %x %u %lu %lu", &start, &cmd, &arg, &r1, &polls, &busy, &dur) == 7) {
+            if (c->n == c->cap) {
+                c->cap    = c->cap ? c->cap * 2 : 64;
+                c->steps  = realloc(c->steps, c->cap * sizeof(*c->steps));
+                c->dur_us = realloc(c->dur_us, c->cap * sizeof(*c->dur_us));
+                if (!c->steps || !c->dur_us) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            c->steps[c->n].cmd   = cmd;
+            c->steps[c->n].arg   = arg;
+            c->steps[c->n].r1    = r1;
+            c->steps[c->n].polls = polls;
+            c->steps[c->n].busy  = busy;
+            c->dur_us[c->n]      = dur;
+            c->n++;
+        }
+    }
+    fclose(f);
+
+    if (c->n == 0) {
+        fprintf(stderr, "%s: no trace records found\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+static const char *cmd_name(uint8_t cmd) {
+    static char buf[12];
+
+    switch (cmd) {
+        case SD_IDLE :        return "CMD0";
+        case SD_INIT :        return "CMD1";
+        case SD_INTER :       return "CMD8";
+        case SD_CSD :         return "CMD9";
+        case SD_CID :         return "CMD10";
+        case SD_STATUS :      return "CMD13";
+        case SD_SET_BLK :     return "CMD16";
+        case SD_READ_BLK :    return "CMD17";
+        case SD_LOCK_UNLOCK : return "CMD42";
+        case CMD55 :          return "CMD55";
+        case SD_OCR :         return "CMD58";
+        case SD_ADV_INIT :    return "ACMD41";
+    }
+    snprintf(buf, sizeof(buf), "%sCMD%u", (cmd & 0x80) ? "A" : "", cmd & 0x3f);
+    return buf;
+}
+
+
+/*
+ * Issue one traced command through the firmware command code, including
+ * whatever data phase the firmware runs after it.
+ */
+static void replay_step(const struct sim_step *s, const struct sim_step *prev) {
+    uint32_t polled = 0;
+    uint16_t n;
+    uint8_t  r1, mask;
+    int i;
+
+    switch (s->cmd) {
+        case SD_CSD :
+            ReadCSD();
+            return;
+        case SD_CID :
+            ReadCID();
+            return;
+        case SD_STATUS :
+            ReadStatus();
+            return;
+        case SD_LOCK_UNLOCK :
+            // A force erase is the only CMD42 behind a 1 byte block length.
+            mask    = (prev && prev->cmd == SD_SET_BLK && prev->arg == 1) ? MASK_ERASE : MASK_LOCK_UNLOCK;
+            pwd_len = 0;
+            if (StartCMD42(mask) != SD_OK) return;
+
+            // Poll as long as the capture did, an erase outlasts one PollBusy(0xffff).
+            do {
+                n = PollBusy(0xffff);
+                polled += n ? n : 0xffff;
+            } while (n == 0 && polled < s->busy);
+            return;
+        case SD_READ_BLK :
+            ReadBlock(s->arg, block);
+            return;
+    }
+
+    r1 = SendCommand(s->cmd, s->arg);
+    switch (s->cmd) {
+        case SD_INTER :
+        case SD_OCR :
+            // InitializeSD() burns 4 bytes while idle, ReadOCR() reads 5 once ready.
+            if (r1 == 0x01) for (i = 0; i < 4; i++) SendByte(0xff);
+            else if (r1 == 0x00) for (i = 0; i < 5; i++) SendByte(0xff);
+            break;
+    }
+}
+
+
+static double now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+static void summarise(const struct capture *c, const double *modelled, struct stat_row rows[256]) {
+    size_t i;
+
+    memset(rows, 0, 256 * sizeof(*rows));
+    for (i = 0; i < c->n; i++) {
+        struct stat_row *r = &rows[c->steps[i].cmd];
+
+        r->count++;
+        r->captured_us += c->dur_us[i];
+        if (c->dur_us[i] > r->captured_max) r->captured_max = c->dur_us[i];
+        if (modelled) r->modelled_us += modelled[i];
+        r->polls += c->steps[i].polls;
+        r->busy  += c->steps[i].busy;
+    }
+}
+
+
+static void usage(void) {
+    fprintf(stderr, "usage: trace_replay [-q] [-r] [-n runs] [-d spi_div] [-c baseline] [-t pct] trace.txt\n");
+    exit(2);
+}
+
+
+int main(int argc, char **argv) {
+    struct capture   cap, base;
+    struct simcard   card;
+    struct stat_row  rows[256], base_rows[256];
+    const char      *baseline = NULL;
+    double          *modelled;
+    double           us_per_byte, t0, wall, total_captured = 0, total_modelled = 0;
+    unsigned         spi_div = 0;
+    int              opt, runs = 1, quiet = 0, realtime = 0, run, regressed = 0;
+    double           threshold = 20.0;
+    size_t           i;
+
+    while ((opt = getopt(argc, argv, "qrn:d:c:t:")) != -1) {
+        switch (opt) {
+            case 'q' : quiet = 1; break;
+            case 'r' : realtime = 1; break;
+            case 'n' : runs = atoi(optarg); break;
+            case 'd' : spi_div = atoi(optarg); break;
+            case 'c' : baseline = optarg; break;
+            case 't' : threshold = atof(optarg); break;
+            default  : usage();
+        }
+    }
+    if (optind != argc - 1 || runs < 1) usage();
+    if (load_capture(argv[optind], &cap) != 0) return 1;
+    if (spi_div == 0) spi_div = cap.spi_div;
+
+    us_per_byte = 8.0 * spi_div * 1e6 / cap.f_cpu;
+    modelled    = calloc(cap.n, sizeof(*modelled));
+
+    if (!quiet) {
+        printf("%zu records, %u lost, F_CPU %lu, SPI fosc/%u (%.1f us/byte)\n",
+               cap.n, cap.lost, cap.f_cpu, spi_div, us_per_byte);
+        printf("%4s %-7s %-8s %-4s %5s %5s %10s %10s\n",
+               "#", "cmd", "arg", "r1", "polls", "busy", "captured", "modelled");
+    }
+
+    t0 = now_us();
+    for (run = 0; run < runs; run++) {
+        simcard_init(&card, cap.steps, cap.n);
+        card.us_per_byte = us_per_byte;
+        card.realtime    = realtime;
+        simcard_attach(&card);
+
+        for (i = 0; i < cap.n; i++) {
+            const struct sim_step *s = &cap.steps[i];
+            unsigned long before = card.bytes;
+
+            /* The ACMD that follows sends its own CMD55. */
+            if (s->cmd == CMD55 && i + 1 < cap.n && (cap.steps[i + 1].cmd & 0x80)) continue;
+            /* So does a force erase with its 1 byte CMD16. */
+            if (s->cmd == SD_SET_BLK && s->arg == 1 && i + 1 < cap.n && cap.steps[i + 1].cmd == SD_LOCK_UNLOCK) continue;
+
+            replay_step(s, i ? &cap.steps[i - 1] : NULL);
+            modelled[i] = (card.bytes - before) * us_per_byte;
+
+            if (!quiet && run == 0) {
+                printf("%4zu %-7s %08lX %02X   %5u %5lu %8lu us %7.0f us\n",
+                       i, cmd_name(s->cmd), (unsigned long)s->arg, s->r1, s->polls, (unsigned long)s->busy,
+                       (unsigned long)cap.dur_us[i], modelled[i]);
+            }
+        }
+    }
+    wall = now_us() - t0;
+
+    for (i = 0; i < cap.n; i++) {
+        total_captured += cap.dur_us[i];
+        total_modelled += modelled[i];
+    }
+
+    summarise(&cap, modelled, rows);
+    printf("\n%-7s %6s %12s %12s %12s %8s %8s\n", "cmd", "count", "captured avg", "captured max", "modelled avg", "polls", "busy");
+    for (i = 0; i < 256; i++) {
+        struct stat_row *r = &rows[i];
+
+        if (r->count == 0) continue;
+        printf("%-7s %6lu %9.0f us %9.0f us %9.0f us %8.1f %8.1f\n", cmd_name(i), r->count,
+               r->captured_us / r->count, r->captured_max, r->modelled_us / r->count,
+               (double)r->polls / r->count, (double)r->busy / r->count);
+    }
+    printf("\ncaptured %.0f us, modelled bus %.0f us, %lu bytes, %lu mismatches\n",
+           total_captured, total_modelled, card.bytes, card.mismatches);
+    printf("replay: %d run(s) in %.0f us, %.2f us per run\n", runs, wall, wall / runs);
+
+    if (baseline) {
+        if (load_capture(baseline, &base) != 0) return 1;
+        summarise(&base, NULL, base_rows);
+
+        printf("\n%-7s %12s %12s %8s\n", "cmd", "baseline avg", "current avg", "change");
+        for (i = 0; i < 256; i++) {
+            double was, is, change;
+
+            if (rows[i].count == 0 || base_rows[i].count == 0) continue;
+            was    = base_rows[i].captured_us / base_rows[i].count;
+            is     = rows[i].captured_us / rows[i].count;
+            change = was > 0 ? (is - was) * 100.0 / was : 0.0;
+            printf("%-7s %9.0f us %9.0f us %+7.1f%%%s\n", cmd_name(i), was, is, change,
+                   change > threshold ? "  REGRESSED" : "");
+            if (change > threshold) regressed = 1;
+        }
+    }
+
+    return (card.mismatches || regressed) ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _SDLOCKER_CACHE_
+#define _SDLOCKER_CACHE_
+
+/*
+ * Read-ahead block cache for browsing. Slot 0 is the shared block[] buffer,
+ * every further slot costs 512 bytes of SRAM, so two by default. Read-ahead
+ * runs as a task, 16 bytes per poll, so the card streams in while the
+ * current block is printed.
+ */
+#ifndef CACHE_SLOTS
+#define CACHE_SLOTS   2
+#endif
+#if CACHE_SLOTS < 2
+#error "CACHE_SLOTS must be at least 2, one slot stays on screen"
+#endif
+
+#define CACHE_CHUNK   16
+#define CACHE_NONE    0xffffffffUL
+
+
+extern uint16_t cache_hits;
+extern uint16_t cache_misses;
+
+extern uint8_t *cache_get(uint32_t blocknum);
+extern void     cache_prefetch(uint32_t blocknum);
+extern void     cache_flush(void);
+
+#endif /* _SDLOCKER_CACHE_ */
@@ -0,0 +1,14 @@
+#ifndef _SDLOCKER_CLOCK_
+#define _SDLOCKER_CLOCK_
+
+
+// Timer1 runs at F_CPU/8, one compare match per millisecond.
+#define CLOCK_PRESCALE      8UL
+#define CLOCK_TICKS_PER_MS  (F_CPU/CLOCK_PRESCALE/1000UL)
+
+
+extern void clock_init(void);
+extern uint32_t clock_ms(void);
+extern uint32_t clock_us(void);
+
+#endif /* _SDLOCKER_CLOCK_ */
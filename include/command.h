@@ -0,0 +1,15 @@
+#ifndef _SDLOCKER_COMMAND_
+#define _SDLOCKER_COMMAND_
+
+/*
+ * Terminal command handling. Shared by the firmware and the host side
+ * device emulator. Every finished command ends with the prompt below so
+ * host tools know when the device is ready for the next key.
+ */
+#define COMMAND_PROMPT  "\r\n> "
+
+
+extern void ShowMenu(void);
+extern void ProcessCommand(void);
+
+#endif /* _SDLOCKER_COMMAND_ */
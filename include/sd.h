@@ -0,0 +1,76 @@
+#ifndef _SDLOCKER_SD_
+#define _SDLOCKER_SD_
+
+#include <stdint.h>
+
+/*
+ * SD Card Commands
+ */
+#define SD_IDLE        (0x40 + 0)   // CMD0: Set SD card to Idle
+#define SD_INIT        (0x40 + 1)   // CMD1: Initialize SD Card
+#define SD_INTER       (0x40 + 8)   // CMD8: Send Interface - Only for SDHC
+#define SD_CSD         (0x40 + 9)   // CMD9: Send CSD Block
+#define SD_CID         (0x40 + 10)  // CMD10: Send CID Bock
+#define SD_STATUS      (0x40 + 13)  // CMD13: Send Card Status
+#define SD_SET_BLK     (0x40 + 16)  // CMD16: CMD16: Set Block Size (Bytes)
+#define SD_READ_BLK    (0x40 + 17)  // Read single block
+#define SD_LOCK_UNLOCK (0x40 + 42)  // CMD42: PWD Lock/Unlock
+#define CMD55          (0x40 + 55)  // Multi-byte preface command
+#define SD_OCR         (0x40 + 58)  // Read OCR
+#define SD_ADV_INIT    (0xc0 + 41)  // ACMD41 Advanced Initialization for SDHC
+
+/*
+ * Masks for CMD42 options
+ */
+#define MASK_ERASE        0x08 //
+#define MASK_LOCK_UNLOCK  0x04
+#define MASK_CLR_PWD      0x02
+#define MASK_SET_PWD      0x01
+
+/*
+ * Options for Types of SD cards.
+ */
+#define  SDTYPE_UNKNOWN		0				/* card type not determined */
+#define  SDTYPE_SD				1				/* SD v1 (1 MB to 2 GB) */
+#define  SDTYPE_SDHC			2				/* SDHC (4 GB to 32 GB) */
+
+// Error codes for functions
+#define SD_OK         0
+#define SD_NO_DETECT  1
+#define SD_TIMEOUT    2
+#define SD_RWFAIL    -1
+
+extern uint8_t pwd[16];
+extern uint8_t pwd_len;
+extern uint8_t sdtype;
+extern uint8_t block[512];
+extern uint8_t cardstatus[2];
+extern uint8_t csd[16];
+extern uint8_t cid[16];
+extern uint8_t ocr[4];
+
+/*
+ * Bus primitives. Provided by src/spi.c on the AVR and by the
+ * simulated card on the host so the command code below runs on both.
+ */
+extern void     Select(void);
+extern void     Deselect(void);
+extern uint8_t  SendByte(uint8_t c);
+
+extern int8_t   SendCommand(uint8_t command, uint32_t arg);
+extern uint8_t  ExecuteCMD42(uint8_t mask);
+extern int8_t   StartCMD42(uint8_t mask);
+extern uint16_t PollBusy(uint16_t max);
+extern int8_t   InitializeSD(void);
+extern int8_t   ReadSD(void);
+extern int8_t   ReadOCR(void);
+extern int8_t   ReadCSD(void);
+extern int8_t   ReadCID(void);
+extern int8_t   ReadStatus(void);
+extern int8_t   WaitForData(void);
+extern int8_t   ReadBlock(uint32_t blocknum, uint8_t *buffer);
+extern int8_t   ReadBlockStart(uint32_t blocknum);
+extern void     ReadBlockData(uint8_t *buffer, uint16_t count);
+extern void     ReadBlockEnd(void);
+
+#endif /* _SDLOCKER_SD_ */
@@ -0,0 +1,10 @@
+#ifndef _SDLOCKER_SPI_
+#define _SDLOCKER_SPI_
+
+
+extern void InitializeSPI(void);
+extern void Select(void);
+extern void Deselect(void);
+extern uint8_t SendByte(uint8_t c);
+
+#endif /* _SDLOCKER_SPI_ */
@@ -0,0 +1,34 @@
+#ifndef _SDLOCKER_TASK_
+#define _SDLOCKER_TASK_
+
+/*
+ * Cooperative task scheduler. A task is a poll function plus its own state.
+ * task_run() calls every task that is due, each poll does one short slice of
+ * work and returns TASK_RUNNING until it is finished. Nothing is preempted,
+ * so a poll must never block.
+ */
+#define TASK_MAX      4
+
+#define TASK_IDLE     0
+#define TASK_RUNNING  1
+#define TASK_DONE     2
+#define TASK_FAILED   3
+
+typedef struct task task_t;
+typedef uint8_t (*task_poll_t)(task_t *task);
+
+struct task {
+    task_poll_t poll;
+    uint16_t    interval;   // ms between polls
+    uint32_t    next;       // clock_ms() when the next poll is due
+    uint32_t    started;    // clock_ms() at task_start()
+    uint32_t    progress;   // task defined, e.g. busy polls so far
+    uint8_t     state;      // task defined step
+    uint8_t     result;     // TASK_RUNNING while scheduled
+};
+
+
+extern uint8_t task_start(task_t *task, task_poll_t poll, uint16_t interval);
+extern void    task_run(void);
+
+#endif /* _SDLOCKER_TASK_ */
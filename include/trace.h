@@ -0,0 +1,43 @@
+#ifndef _SDLOCKER_TRACE_
+#define _SDLOCKER_TRACE_
+
+/*
+ * Optional SPI transaction trace. Build with SD_TRACE=1 to record every
+ * SendCommand() into a small ring, drained over the UART with 't'.
+ *
+ * Dump format, one record per line:
+ *   TRACE <version> <f_cpu> <spcr> <spsr> <count> <lost>
+ *   E <start_us> <cmd> <arg> <r1> <polls> <busy> <dur_us>
+ *   END
+ * cmd, arg, r1, spcr and spsr are hex, everything else decimal.
+ */
+#ifndef SD_TRACE
+#define SD_TRACE 0
+#endif
+
+#define TRACE_VERSION 2   // 2: busy is 32 bit, a force erase runs for minutes
+#define TRACE_DEPTH   16
+
+typedef struct {
+    uint32_t start;   // clock_us() when the command frame started
+    uint32_t end;     // clock_us() at R1, or after the last data/busy poll
+    uint32_t arg;
+    uint16_t polls;   // 0xFF clocks sent before R1 came back
+    uint32_t busy;    // clocks spent waiting for a data token or busy release
+    uint8_t  cmd;     // high bit set for ACMDs
+    uint8_t  r1;
+} trace_entry_t;
+
+#if SD_TRACE
+extern void trace_begin(uint8_t cmd, uint32_t arg);
+extern void trace_end(uint8_t r1, uint16_t polls);
+extern void trace_busy(uint16_t polls);
+extern void trace_dump(void);
+#else
+static inline void trace_begin(uint8_t cmd, uint32_t arg) {}
+static inline void trace_end(uint8_t r1, uint16_t polls) {}
+static inline void trace_busy(uint16_t polls) {}
+static inline void trace_dump(void) {}
+#endif
+
+#endif /* _SDLOCKER_TRACE_ */
@@ -0,0 +1,133 @@
+#include <avr/io.h>
+#include <stdio.h>
+#include "../include/sd.h"
+#include "../include/task.h"
+#include "../include/cache.h"
+
+
+uint16_t cache_hits;
+uint16_t cache_misses;
+
+static uint8_t  spare[CACHE_SLOTS - 1][512];
+static uint32_t tag[CACHE_SLOTS];     // block held, CACHE_NONE if empty
+static uint16_t fill[CACHE_SLOTS];    // bytes valid, 512 once complete
+static uint8_t  used[CACHE_SLOTS];    // use order for picking a victim
+static uint8_t  ticks;
+static uint8_t  mru;                  // slot last handed out, never evicted
+
+static task_t   prefetch;
+static uint8_t  prefetchSlot;
+
+
+static uint8_t *slot_buffer(uint8_t s) {
+    return s == 0 ? block : spare[s - 1];
+}
+
+
+static void touch(uint8_t s) {
+    used[s] = ++ticks;
+    mru = s;
+}
+
+
+/*
+ * Least recently used slot other than the one on screen.
+ */
+static uint8_t victim(void) {
+    uint8_t s, pick = (mru + 1) % CACHE_SLOTS;
+
+    for (s = 0; s < CACHE_SLOTS; s++) {
+        if (s != mru && (uint8_t)(ticks - used[s]) > (uint8_t)(ticks - used[pick])) pick = s;
+    }
+    return pick;
+}
+
+
+static uint8_t prefetch_task(task_t *t) {
+    uint8_t s = prefetchSlot;
+
+    ReadBlockData(slot_buffer(s) + fill[s], CACHE_CHUNK);
+    fill[s] += CACHE_CHUNK;
+    t->progress = fill[s];
+    if (fill[s] < 512) return TASK_RUNNING;
+
+    ReadBlockEnd();
+    return TASK_DONE;
+}
+
+
+/*
+ * Buffer holding blocknum, read from the card on a miss. NULL if the read
+ * fails. Valid until the next cache call.
+ */
+uint8_t *cache_get(uint32_t blocknum) {
+    uint8_t s;
+
+    // The bus is shared, let a read-ahead in flight finish first.
+    while (prefetch.result == TASK_RUNNING) task_run();
+
+    for (s = 0; s < CACHE_SLOTS; s++) {
+        if (tag[s] == blocknum && fill[s] == 512) {
+            cache_hits++;
+            touch(s);
+            return slot_buffer(s);
+        }
+    }
+
+    cache_misses++;
+    s = victim();
+    tag[s]  = CACHE_NONE;
+    fill[s] = 0;
+    if (ReadBlock(blocknum, slot_buffer(s)) != SD_OK) return NULL;
+
+    tag[s]  = blocknum;
+    fill[s] = 512;
+    touch(s);
+    return slot_buffer(s);
+}
+
+
+/*
+ * Start reading blocknum into a free slot in the background.
+ */
+void cache_prefetch(uint32_t blocknum) {
+    uint8_t s;
+
+    if (blocknum == CACHE_NONE || prefetch.result == TASK_RUNNING) return;
+    for (s = 0; s < CACHE_SLOTS; s++) if (tag[s] == blocknum) return;
+
+    s = victim();
+    tag[s]  = CACHE_NONE;
+    fill[s] = 0;
+    if (ReadBlockStart(blocknum) != SD_OK) return;
+
+    tag[s] = blocknum;
+    used[s] = ticks;
+    prefetchSlot = s;
+    if (task_start(&prefetch, prefetch_task, 0) != TASK_RUNNING) {
+        // No free task slot, read it now.
+        ReadBlockData(slot_buffer(s), 512);
+        ReadBlockEnd();
+        fill[s] = 512;
+    }
+}
+
+
+/*
+ * Drop everything, block[] is about to be reused or the card changed.
+ */
+void cache_flush(void) {
+    uint8_t s;
+
+    while (prefetch.result == TASK_RUNNING) task_run();
+
+    for (s = 0; s < CACHE_SLOTS; s++) {
+        tag[s]  = CACHE_NONE;
+        fill[s] = 0;
+        used[s] = 0;
+    }
+    ticks = 0;
+    mru   = 0;
+    cache_hits   = 0;
+    cache_misses = 0;
+}
@@ -0,0 +1,48 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "../include/clock.h"
+
+
+static volatile uint32_t milliseconds;
+
+
+/*
+ * Timer1 in CTC mode, prescaler 8. OCR1A is reached once per millisecond and
+ * TCNT1 gives the sub-millisecond part for timestamps.
+ */
+void clock_init(void) {
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12) | _BV(CS11);
+    OCR1A  = CLOCK_TICKS_PER_MS - 1;
+    TIMSK1 = _BV(OCIE1A);
+}
+
+
+ISR(TIMER1_COMPA_vect) {
+    milliseconds++;
+}
+
+
+uint32_t clock_ms(void) {
+    uint32_t ms;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = milliseconds;
+    }
+    return ms;
+}
+
+
+uint32_t clock_us(void) {
+    uint32_t ms;
+    uint16_t ticks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms    = milliseconds;
+        ticks = TCNT1;
+        /* Compare matched after interrupts were blocked, count it here. */
+        if (bit_is_set(TIFR1, OCF1A) && ticks < CLOCK_TICKS_PER_MS / 2) ms++;
+    }
+    return ms * 1000UL + (uint32_t)ticks * 1000UL / CLOCK_TICKS_PER_MS;
+}
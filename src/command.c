@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <avr/io.h>
+#include <util/delay.h>
+#include <avr/pgmspace.h>
+#include "../include/uart.h"
+#include "../include/sd.h"
+#include "../include/clock.h"
+#include "../include/trace.h"
+#include "../include/task.h"
+#include "../include/cache.h"
+#include "../include/command.h"
+
+// CMDs to run against SD Card
+#define  CMD_LOCK		    1
+#define  CMD_UNLOCK		  2
+#define  CMD_NONE		    3
+#define  CMD_INFO		    4
+#define  CMD_READBLK		5
+#define  CMD_PWD_LOCK	  6
+#define  CMD_PWD_UNLOCK	7
+#define  CMD_PWD_CHECK	8
+#define  CMD_LOCK_CHECK	9
+#define  CMD_ERASE		  10
+#define  CMD_PWD_CLEAR  11
+#define  CMD_TRACE      12
+#define  CMD_BROWSE     13
+
+// Card busy task pacing. One slice of polls every interval, ~8ms of SPI at fosc/128.
+#define BUSY_INTERVAL   50
+#define BUSY_SLICE      64
+#define BUSY_REPORT     10000UL   // Progress line every 10s
+#define CMD42_TIMEOUT   10000UL
+#define ERASE_TIMEOUT   240000UL  // Force erase may take minutes
+
+static task_t   busy;
+static uint8_t  busyMask;
+static uint32_t busyLimit;
+
+/*
+ * Local function declaration
+ */
+static void 	  Done(void);
+static void 		LoadEnteredPassword(void);
+static uint8_t  ReadCommand(void);
+static void     DisplayStatus(void);
+static void     DisplayBlock(uint8_t *buffer);
+static void     Browse(void);
+static uint32_t ReadNumber(void);
+static uint8_t  RunCMD42(uint8_t mask);
+static uint8_t  StartBusy(uint8_t mask, uint32_t limit);
+static uint8_t  CardBusyTask(task_t *t);
+static uint8_t  WaitForTask(task_t *t);
+static void     ShowBusy(void);
+
+/*
+ * ShowMenu function
+ * Clears the terminal and lists the available commands.
+ */
+void ShowMenu(void) {
+  printf_P(PSTR("%c[2J"), 27); // Send escape code to clear UART Terminal.
+  printf_P(PSTR("\r\nCryptkeeper SD Card Tool\r\n"));
+  printf_P(PSTR("? - Read Card Status\r\n"));
+  printf_P(PSTR("u - Attempt Unlock\r\n"));
+  printf_P(PSTR("l - Lock\r\n"));
+  printf_P(PSTR("c - Clear Password\r\n"));
+  printf_P(PSTR("r - Read Card\r\n"));
+  printf_P(PSTR("b - Browse Blocks\r\n"));
+  printf_P(PSTR("e - Force Erase\r\n"));
+#if SD_TRACE
+  printf_P(PSTR("t - Dump SPI Trace\r\n"));
+#endif
+  printf_P(PSTR(COMMAND_PROMPT));
+}
+
+/*
+ * ProcessCommand function
+ * Beginning of code flow, kicked off by main(). This process loops awaiting
+ * user input, either through switches or UART -- Some form of user input.
+ */
+void ProcessCommand(void) {
+  uint8_t         cmd, i;
+  static uint8_t  prevCMD = 0;
+  uint8_t         response;
+
+  cmd = ReadCommand();
+
+  if((cmd != prevCMD) && (prevCMD == CMD_NONE) && (cmd == CMD_TRACE)) {
+    // Drain before InitializeSD() so the dump only holds the previous session.
+    trace_dump();
+    printf_P(PSTR(COMMAND_PROMPT));
+    prevCMD = cmd;
+    return;
+  }
+
+  if(busy.result == TASK_RUNNING) {
+    // Card is held by a background task, only report on it.
+    if((cmd != prevCMD) && (prevCMD == CMD_NONE)) {
+      if(cmd == CMD_INFO) ShowBusy();
+      else printf_P(PSTR("\nCard busy, press ? for progress."));
+      printf_P(PSTR(COMMAND_PROMPT));
+    }
+    prevCMD = cmd;
+    return;
+  }
+
+  if((cmd != prevCMD) && (prevCMD == CMD_NONE)) {
+
+  response = InitializeSD();
+  if(response != SD_OK) printf_P(PSTR("\n\r\n\rUnable to initialize card."));
+
+  /*
+   * If card passes init vibe check, begin processing command.
+   */
+   if(cmd == CMD_INFO) {
+     printf_P(PSTR("\r\nCard Type: %d"), sdtype);
+     response = ReadSD();
+     if(response == SD_OK) {
+       printf_P(PSTR("\r\nOCR: "));
+       for(i = 0; i < 4; i++) printf_P(PSTR("%02X "), ocr[i]);
+       printf_P(PSTR("\r\nCSD: "));
+       for(i = 0; i < 16; i++) printf_P(PSTR("%02X "), csd[i]);
+       printf_P(PSTR("\r\nCID: "));
+       for(i = 0; i < 16; i++) printf_P(PSTR("%02X "), cid[i]);
+       DisplayStatus();
+     } else printf_P(PSTR("\r\nCard Registers could not be read."));
+   } else if(cmd == CMD_PWD_CLEAR) {
+     ReadStatus();
+     if(cardstatus[1] & 0x01) {
+       LoadEnteredPassword();
+       response = RunCMD42(MASK_CLR_PWD);
+       ReadStatus();
+       if(cardstatus[1] & 0x01) {
+         printf_P(PSTR("\nFailed! Retrying..."));
+         response = RunCMD42(MASK_CLR_PWD);
+         ReadStatus();
+         if(cardstatus[1] & 0x01) printf_P(PSTR("\nFailed: The card is still locked."));
+       } else Done();
+     } else printf_P(PSTR("\nThe card is not locked."));
+   } else if(cmd == CMD_READBLK) {
+
+     //ToDo
+     response = ReadBlock(0, block);
+
+     if(response != SD_OK) printf_P(PSTR("\nError: Unable to read block."));
+     else DisplayBlock(block);
+   } else if(cmd == CMD_BROWSE) {
+     Browse();
+   } else if(cmd == CMD_PWD_LOCK) {
+     ReadStatus();
+
+     if((cardstatus[1] & 0x01) == 0) {
+       LoadEnteredPassword();
+       printf_P(PSTR("\r\nAttempting to set password."));
+       response = RunCMD42(MASK_SET_PWD);
+       ReadStatus();
+
+       printf_P(PSTR("\nAttempting to lock card."));
+       response = RunCMD42(MASK_LOCK_UNLOCK);
+       ReadStatus();
+       if((cardstatus[1] & 0x01) == 0) printf_P(PSTR("\nFailed: there was an error attempting to lock card."));
+       else Done();
+     } else printf_P(PSTR("\nThe card is already locked."));
+   } else if(cmd == CMD_PWD_UNLOCK) {
+     ReadStatus();
+
+     if(cardstatus[1] & 0x01) {
+       LoadEnteredPassword();
+       printf_P(PSTR("\nAttempting to unlock card."));
+       response = RunCMD42(00000100);
+       ReadStatus();
+       if(cardstatus[1] & 0x01) {
+         printf_P(PSTR("\nUnlock Failed: Attempting unlock again."));
+         response = RunCMD42(00000100);
+         ReadStatus();
+         if(cardstatus[1] & 0x01) printf_P(PSTR("\nUnlock Failed: Unable to unlock card."));
+       } else Done();
+     } else printf_P(PSTR("\nCard is already unlocked."));
+   } else if(cmd == CMD_ERASE) {
+     ReadStatus();
+
+     if(cardstatus[1] & 0x01) {
+       printf_P(PSTR("\nForce erase wipes the password and ALL data. Press Y to continue."));
+       while(!uart_pending_data());
+       if(getchar() == 'Y') {
+         if(StartCMD42(MASK_ERASE) == SD_OK && StartBusy(MASK_ERASE, ERASE_TIMEOUT) == TASK_RUNNING)
+           printf_P(PSTR("\nErasing, this can take minutes. Press ? for progress."));
+         else printf_P(PSTR("\nFailed: the card refused force erase."));
+       } else printf_P(PSTR("\nForce erase cancelled."));
+     } else printf_P(PSTR("\nForce erase only works on a locked card."));
+   }
+
+  printf_P(PSTR(COMMAND_PROMPT));
+  }
+  prevCMD = cmd;
+}
+
+/*
+ * ReadCommand function
+ * This is called during ProcessCommand and is used to determine CMD options/state
+ * Returns CMD selected as response.
+ */
+static uint8_t ReadCommand(void) {
+  uint8_t response;
+
+  _delay_ms(50);
+  response = CMD_NONE;
+  // Wait for data from UART.
+  if(uart_pending_data()) {
+    response = getchar();
+    printf_P(PSTR("\n%c"), response);
+
+    switch (response) {
+      case '?' :
+        response = CMD_INFO;
+        break;
+      case 'r' :
+        response = CMD_READBLK;
+        break;
+      case 'u' :
+        response = CMD_PWD_UNLOCK;
+        break;
+      case 'l' :
+        response = CMD_PWD_LOCK;
+        break;
+      case 'c' :
+        response = CMD_PWD_CLEAR;
+        break;
+      case 'b' :
+        response = CMD_BROWSE;
+        break;
+      case 'e' :
+        response = CMD_ERASE;
+        break;
+#if SD_TRACE
+      case 't' :
+        response = CMD_TRACE;
+        break;
+#endif
+      default  :
+        response = CMD_NONE;
+    }
+  }
+
+  return response;
+}
+
+/*
+ * DisplayStatus() function
+ * Determines lock status.
+ */
+static void DisplayStatus(void) {
+  ReadStatus();
+
+  printf_P(PSTR("\r\nPassword Status: "));
+  if((cardstatus[1] & 0x01) == 0) printf_P(PSTR("Unlocked\n"));
+  else printf_P(PSTR("Locked\n"));
+}
+
+/*
+ * DisplayStatus function
+ * Function to format and display the Data Block obtained from ReadBlock function.
+ */
+static void DisplayBlock(uint8_t *buffer) {
+  uint16_t i;
+  uint8_t  str[17];
+
+	str[16] = 0;
+	str[0] = 0;			// only need for first newline, overwritten as chars are processed
+
+	printf_P(PSTR("\n\rContents of block buffer:"));
+	for (i=0; i<512; i++) {
+		if ((i % 16) == 0) {
+			task_run(); // Lets a cache read-ahead stream in line by line.
+			printf_P(PSTR(" %s\n\r%04X: "), str, i);
+		}
+
+		printf_P(PSTR("%02X "), buffer[i]);
+
+		if (isalpha(buffer[i]) || isdigit(buffer[i]))  str[i%16] = buffer[i];
+		else str[i%16] = '.';
+	}
+	printf_P(PSTR(" %s\n\r"), str);
+}
+
+/*
+ * Browse function
+ * Pages through the card a block at a time. Views come from the block cache,
+ * which reads ahead in the direction of travel while a block is on screen.
+ */
+static void Browse(void) {
+  uint32_t blocknum = 0;
+  int8_t   dir = 1;
+  uint16_t hits;
+  uint8_t  key, *buffer;
+
+  cache_flush();
+
+  while(1) {
+    hits   = cache_hits;
+    buffer = cache_get(blocknum);
+
+    if(buffer == NULL) printf_P(PSTR("\nError: Unable to read block %lu."), (unsigned long)blocknum);
+    else {
+      if(dir > 0 || blocknum > 0) cache_prefetch(blocknum + dir);
+      printf_P(cache_hits != hits ? PSTR("\r\nBlock %lu (cached)") : PSTR("\r\nBlock %lu"),
+               (unsigned long)blocknum);
+      DisplayBlock(buffer);
+    }
+
+    printf_P(PSTR("\r\nn - Next, p - Prev, j - Jump, q - Quit "));
+    while(!uart_pending_data()) task_run();
+    key = getchar();
+
+    if(key == 'n') {
+      blocknum++;
+      dir = 1;
+    } else if(key == 'p') {
+      if(blocknum > 0) blocknum--;
+      dir = -1;
+    } else if(key == 'j') {
+      blocknum = ReadNumber();
+      dir = 1;
+    } else if(key == 'q') break;
+  }
+
+  printf_P(PSTR("\r\n%u cached, %u read"), cache_hits, cache_misses);
+  cache_flush();
+}
+
+/*
+ * ReadNumber function
+ * Reads a decimal number from the UART, terminated by enter.
+ */
+static uint32_t ReadNumber(void) {
+  uint32_t n = 0;
+  uint8_t  r;
+
+  printf_P(PSTR("\r\nBlock: "));
+  while(1) {
+    if(uart_pending_data()) {
+      r = getchar();
+      if(r == '\r') break;
+      if(r == 127) n /= 10;
+      else if(isdigit(r)) n = n * 10 + (r - '0');
+      else continue;
+      printf_P(PSTR("%c"), r);
+    }
+  }
+
+  return n;
+}
+
+/*
+ * RunCMD42 function
+ * CMD42 with the card busy phase run as a task. Keeps answering '?' with
+ * progress while the card programs.
+ */
+static uint8_t RunCMD42(uint8_t mask) {
+  if(StartCMD42(mask) != SD_OK) return SD_RWFAIL;
+  if(StartBusy(mask, CMD42_TIMEOUT) != TASK_RUNNING) return SD_RWFAIL;
+
+  if(WaitForTask(&busy) == TASK_DONE) return SD_OK;
+  else return SD_RWFAIL;
+}
+
+/*
+ * StartBusy function
+ * Schedules CardBusyTask for the busy phase that follows StartCMD42().
+ */
+static uint8_t StartBusy(uint8_t mask, uint32_t limit) {
+  busyMask  = mask;
+  busyLimit = limit;
+  return task_start(&busy, CardBusyTask, BUSY_INTERVAL);
+}
+
+/*
+ * CardBusyTask function
+ * Polls a busy card one slice at a time so the UART keeps being serviced.
+ * Force erase runs in the background and reports its own result.
+ */
+static uint8_t CardBusyTask(task_t *t) {
+  uint16_t polls;
+  uint32_t elapsed;
+
+  polls   = PollBusy(BUSY_SLICE);
+  elapsed = clock_ms() - t->started;
+
+  if(polls == 0) {
+    t->progress += BUSY_SLICE;
+    if(elapsed < busyLimit) {
+      if(elapsed >= (t->state + 1) * BUSY_REPORT) {
+        t->state++;
+        ShowBusy();
+      }
+      return TASK_RUNNING;
+    }
+  } else t->progress += polls;
+
+  Deselect();
+  SendByte(0xff);
+
+  if(busyMask & MASK_ERASE) {
+    SendCommand(SD_SET_BLK, 512); // Erase ran with a 1 byte block length.
+    if(polls) printf_P(PSTR("\nForce erase finished after %lu s."), (unsigned long)(elapsed / 1000));
+    else printf_P(PSTR("\nForce erase timed out after %lu s."), (unsigned long)(elapsed / 1000));
+  }
+
+  return polls ? TASK_DONE : TASK_FAILED;
+}
+
+/*
+ * WaitForTask function
+ * Runs the scheduler until the task finishes. '?' reports progress meanwhile.
+ */
+static uint8_t WaitForTask(task_t *t) {
+  while(t->result == TASK_RUNNING) {
+    task_run();
+    if(uart_pending_data() && getchar() == '?') ShowBusy();
+  }
+  return t->result;
+}
+
+/*
+ * ShowBusy function
+ * Reports what the card is busy with, time elapsed and busy polls so far.
+ */
+static void ShowBusy(void) {
+  printf_P(PSTR("\r\nCard busy: "));
+  if(busyMask & MASK_ERASE) printf_P(PSTR("force erase"));
+  else if(busyMask & MASK_LOCK_UNLOCK) printf_P(PSTR("lock/unlock"));
+  else if(busyMask & MASK_CLR_PWD) printf_P(PSTR("clear password"));
+  else if(busyMask & MASK_SET_PWD) printf_P(PSTR("set password"));
+  else printf_P(PSTR("unlock"));
+  printf_P(PSTR(", %lu s elapsed, %lu polls"), (unsigned long)((clock_ms() - busy.started) / 1000),
+           (unsigned long)busy.progress);
+}
+
+/*
+ * Get user input for an attempted password and then Load that password into memory.
+ * Loop until terminating character of enter
+ */
+static void LoadEnteredPassword(void) {
+	uint8_t r;
+	uint8_t i = 0;
+
+	_delay_ms(50);
+	printf_P(PSTR("\n\nPlease Enter Password:\r\n"));
+
+	// Loop until enter key (\r) press. Build PWD and PWD_LEN. Backspace functionality.
+	while(1) {
+		if(uart_pending_data()) {
+			r = getchar();
+			printf_P(PSTR("%c"), r);
+
+			if (r == 127) {
+				i--;
+				continue;
+			} else if(r == '\r') {
+				pwd_len = i;
+				break;
+			} else {
+				pwd[i] = r;
+				i++;
+			}
+
+		}
+	}
+
+}
+
+/*
+ * Laziness.
+ */
+static void Done(void) {
+	printf_P(PSTR("\ndone.\n"));
+}
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <avr/pgmspace.h>
+#include "../include/sd.h"
+#include "../include/trace.h"
+
+uint8_t pwd[16];
+uint8_t pwd_len;
+uint8_t sdtype;
+uint8_t block[512];
+uint8_t cardstatus[2];
+uint8_t csd[16];
+uint8_t cid[16];
+uint8_t ocr[4];
+
+/*
+ * SD Card Initialization function.
+ * This will begin by setting SD to idle mode.
+ * Then it will probe the card to check for SDHC which requires ACMD41 interface
+ * and advanced intialization methods.
+ * Returns SD_OK or SD_NO_DETECT.
+ */
+int8_t InitializeSD(void) {
+  int i;
+  int8_t response;
+
+  sdtype = SDTYPE_UNKNOWN;
+
+  Deselect();
+
+  // Send bytes while card stabilizes.
+  for(i=0; i < 10; i++) SendByte(0xff);
+
+  for(i = 0; i < 0x10; i++) {
+    response = SendCommand(SD_IDLE, 0); // Try SD_IDLE until success or timeout.
+    if(response == 1) break;
+  }
+  if(response != 1) return SD_NO_DETECT;
+
+  SendCommand(SD_SET_BLK, 512); // Set block length to 512 bytes.
+
+  // Always attempt ACMD41 first for SDC then drop to CMD1
+  response = SendCommand(SD_INTER, 0x1aa);
+  if(response == 0x01) {
+    for(i = 0; i < 4; i++) SendByte(0xff);          // Clock through 4 bytes to burn 32 bit lower response.
+    for(i = 20000; i > 0; i--) {                    // Send Advanced init cmd until initialization complete and response is 0x00
+      response = SendCommand(SD_ADV_INIT, 1UL<<30); // Send advanced init with HCS bit 30 set.
+      if(response == 0) break;
+    }
+    sdtype = SDTYPE_SDHC;
+  } else { // Begin initializing SDSC -- CMD1
+    response = SendCommand(SD_OCR, 0); // Not necessary if voltage is set correctly.
+    if(response == 0x01) {
+      for(i = 0; i < 4; i++) SendByte(0xff); // Burn the next 4 bytes returned (OCR)
+    }
+    for(i = 20000; i > 0; i--) {
+      response = SendCommand(SD_INIT, 0);
+      if(response == 0) break;
+    }
+    SendCommand(SD_SET_BLK, 512); // SDSC might reset block length to 1024, reinit to 512.
+    sdtype = SDTYPE_SD;
+  }
+
+  SendByte(0xff); // End initialization with 8 clocks.
+
+  // Initialization should be completed. The SPI clock rate can be set to maximum, usually 20MHz. Depends on card.
+  return SD_OK;
+}
+
+/*
+ * ReadSD function
+ * Kicks off a basic read of the available data registers.
+ * OCR, CSD, CID.
+ */
+int8_t ReadSD(void) {
+   int8_t response;
+
+   response = ReadOCR();
+   response = ReadCSD();
+
+   if(response == SD_OK) response = ReadCID();
+   if(response == SD_OK) response = ReadStatus();
+
+   return response;
+}
+
+/*
+ * ReadOCR function
+ * Requests a read of the card OCR.
+ * Method of read is based on SD Card Type.
+ */
+int8_t ReadOCR(void) {
+  uint8_t i;
+  int8_t  response;
+
+  if(sdtype == SDTYPE_SDHC) {
+    response = SendCommand(SD_INTER, 0x1aa);
+    if(response != 0) return SD_RWFAIL;
+    for(i=0; i < 4; i++) ocr[i] = SendByte(0xff);
+    SendByte(0xff);                                // Burn the remaining CRC bits.
+  } else {
+    response = SendCommand(SD_OCR, 0);
+    if(response != 0x00) return SD_RWFAIL;         // Check response returned from CMD.
+    for(i=0; i < 4; i++)  ocr[i] = SendByte(0xff); // Next four bytes will be the OCR.
+    SendByte(0xff);                                // Burn the remaining byte.
+  }
+
+  return SD_OK;
+}
+
+/*
+ * ReadCSD function
+ * Requests a read of the Card Specific Data (CSD)
+ */
+int8_t ReadCSD(void) {
+  int8_t  response;
+
+  SendCommand(SD_CSD, 0);
+  response = WaitForData();
+  if (response != (int8_t)0xfe) return SD_RWFAIL;
+
+  // CSD returns 16 Bytes. -- Grab those.
+  for(int i=0; i < 16; i++) csd[i] = SendByte(0xff);
+  SendByte(0xff); // Burn the CRC.
+
+  return SD_OK;
+}
+
+/*
+ * ReadCID function
+ * Requests a read of the card Card Identification Data.
+ */
+int8_t ReadCID(void) {
+  int8_t response;
+
+  SendCommand(SD_CID, 0);
+  response = WaitForData();
+	if(response != (int8_t)0xfe) return SD_RWFAIL;
+
+  // CID returns R1 response and 16 bytes.
+  for(uint8_t i = 0; i < 16; i++) cid[i] = SendByte(0xff);
+
+  SendByte(0xff); //Burn CRC
+
+  return SD_OK;
+}
+
+/*
+ * ReadStatus function
+ * Reads the card status via CMD13
+ */
+int8_t ReadStatus(void) {
+  cardstatus[0] = SendCommand(SD_STATUS, 0);
+  cardstatus[1] = SendByte(0xff);
+
+  SendByte(0xff);
+  return  SD_OK;
+}
+
+/*
+ * ReadBlock function
+ * This will execute CMD17 - Read Block command to read one 512 byte block from the card.
+ */
+int8_t ReadBlock(uint32_t startblock, uint8_t *buffer) {
+   if(ReadBlockStart(startblock) != SD_OK) return SD_RWFAIL;
+
+   ReadBlockData(buffer, 512); // Grab the next 512 bytes.
+   ReadBlockEnd();
+
+   return SD_OK;
+}
+
+/*
+ * ReadBlockStart function
+ * Sends CMD17 and waits for the data token. The block is then clocked out in
+ * any number of ReadBlockData() calls, the clock can pause in between.
+ */
+int8_t ReadBlockStart(uint32_t startblock) {
+  uint8_t   status;
+  uint32_t  address;
+
+  /*
+   * CMD17:
+   * SDSC uses a Byte Address
+   * SDHC uses block number
+   */
+
+   address = startblock;
+   if(sdtype == SDTYPE_SD) address = startblock << 9; // Convert to Byte Address.
+
+   status = SendCommand(SD_READ_BLK, address); // Send CMD17
+   if(status != SD_OK) return SD_RWFAIL; // Check returned status from CMD
+
+   status = WaitForData(); // Wait for 0xFE marking start of block read.
+   if(status != 0xFE) return SD_RWFAIL; // Check status.
+
+   return SD_OK;
+}
+
+/*
+ * ReadBlockData function
+ * Reads the next count bytes of the block started by ReadBlockStart().
+ */
+void ReadBlockData(uint8_t *buffer, uint16_t count) {
+  uint16_t i;
+
+  for(i = 0; i < count; i++) buffer[i] = SendByte(0xFF);
+}
+
+/*
+ * ReadBlockEnd function
+ * Burns the CRC once all 512 bytes are read.
+ */
+void ReadBlockEnd(void) {
+  // Send dummy data to complete process.
+  SendByte(0xFF);
+  SendByte(0xFF);
+}
+
+/*
+ * SendCommand
+ * Function accepts an SD CMD and 4 byte argument.
+ * Exchanges CMD and arg with CRC and 0xff filled bytes with card.
+ * Returns the response provided by the card.
+ * For advanced initilization and commands this will send the required preface CMD55
+ * Error codes will be 0xff for no response, 0x01 for OK, or CMD specific responses.
+ */
+int8_t SendCommand(uint8_t cmd, uint32_t arg) {
+  uint8_t response, crc, acmd;
+  uint16_t polls = 0;
+
+  /*
+   * Needed for SDC and advanced initilization.
+   * ACMD(n) requires CMD55 to be sent first.
+   */
+  acmd = cmd & 0x80;
+  if(acmd) {
+    cmd = cmd & 0x7f; // Stripping high bit.
+    response = SendCommand(CMD55, 0);
+    if (response > 1) return response;
+  }
+
+  trace_begin(cmd | acmd, arg);
+
+  Deselect();
+  SendByte(0xff);
+  Select();
+  SendByte(0xff);
+
+  /*
+   * Begin sending command
+   * Command structure is 48 bits??
+   */
+   SendByte(cmd | 0x40);
+   SendByte((unsigned char)(arg>>24));
+   SendByte((unsigned char)(arg>>16));
+   SendByte((unsigned char)(arg>>8));
+   SendByte((unsigned char)(arg&0xff));
+   if(cmd == SD_IDLE)  crc = 0x95;
+   if(cmd == SD_INTER) crc = 0x87;
+   SendByte(crc);
+
+   // Send clocks waiting for timeout.
+   do {
+      response = SendByte(0xff);
+      polls++;
+    } while((response & 0x80) != 0); // High bit cleared means OK
+
+   trace_end(response, polls);
+
+   // Switch statement with fall through and default. Deselecting card if no more R/W operations required.
+   switch (cmd) {
+     case SD_ADV_INIT :
+     case SD_SET_BLK :
+     case SD_IDLE :
+     case SD_INIT :
+     case CMD55 :
+       Deselect();
+       SendByte(0xff);
+     default :
+       break;
+   }
+
+   return response;
+}
+
+/*
+ * This function will handles all CMD42 executions.
+ * Seperate from SendCommand for building CMD42 specific data blocks
+ * PWD, PWD_LEN, CRC (Theoretically should not matter as CRC is not checked in SPI mode).
+ * Blocks until the card finishes programming, see StartCMD42() for the non-blocking half.
+ */
+uint8_t ExecuteCMD42(uint8_t mask) {
+	if(StartCMD42(mask) != SD_OK) return SD_RWFAIL;
+
+	if(PollBusy(0xffff)) return SD_OK; // Waiting for card.
+	else return SD_RWFAIL;
+}
+
+/*
+ * StartCMD42 function
+ * Sends CMD42 and its data block, then returns while the card is still busy
+ * programming. SD_RWFAIL if the card does not accept the block. The card
+ * stays selected; poll PollBusy() until it lets go.
+ */
+int8_t StartCMD42(uint8_t mask) {
+	uint8_t response;
+	uint16_t i;
+	mask = mask & 0x0f; // Bitwise operator, flip high bits.
+	// 00000010 with bitwise AND 0x0f - Clears PWD NO ERASE.
+	// 00000100 with bitwise AND 0x0f - Unlocking for current session - NO ERASE.
+	// 00001000 with bitwise AND 0x0f - Force erase, wipes PWD and all data.
+
+	// Force erase data block is the single mask byte, block length must match.
+	if(mask & MASK_ERASE) SendCommand(SD_SET_BLK, 1);
+
+	Deselect(); // Just in case.
+	Select();   // CMD7 Select the card. Place in Transfer/Receive mode.
+
+	// No need to set block size. BLK set in SDInit()
+	response = SendCommand(SD_LOCK_UNLOCK, 0); // Send unlock command.
+	if(response != 0) return SD_RWFAIL;        // Check response.
+
+	SendByte(0xfe);	   // Data token marking start of block.
+	SendByte(mask);    // Start with the correct command.
+
+	if((mask & MASK_ERASE) == 0) {
+		SendByte(pwd_len); // Send pwd length
+
+		// Sending 1 full 512 byte block.
+		for(i = 0; i < 512; i++) {
+			if(i < pwd_len) {
+				printf_P(PSTR("\nExchaning Byte: %c"), pwd[i]);
+				SendByte(pwd[i]);
+			} else SendByte(0xff);
+		}
+	}
+
+	// Closing with 2x 8 clocks
+	SendByte(0xff);
+	SendByte(0xff);
+
+	// Data response token xxx0sss1 comes before the busy phase, 0x05 is accepted.
+	response = SendByte(0xff);
+	if((response & 0x1f) != 0x05) return SD_RWFAIL;
+
+	return SD_OK;
+}
+
+/*
+ * PollBusy function
+ * The card holds MISO low while busy programming. Clocks at most max bytes.
+ * Returns the number of polls it took the card to release, or 0 if still busy.
+ */
+uint16_t PollBusy(uint16_t max) {
+	uint16_t i = 0;
+
+	while(i < max) {
+		i++;
+		if(SendByte(0xFF)) {
+			trace_busy(i);
+			return i;
+		}
+	}
+
+	trace_busy(i);
+	return 0;
+}
+
+/*
+ * WaitForData function
+ * Used for commands that require processing and timeouts while awaiting response
+ * that is not 0xff.
+ */
+int8_t WaitForData(void) {
+	int16_t				i;
+	uint8_t				response;
+
+	for (i = 0; i < 100; i++) {
+		response = SendByte(0xff);
+		if (response != 0xff) break;
+	}
+	trace_busy(i < 100 ? i + 1 : i);
+
+	return  (int8_t) response;
+}
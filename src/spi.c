@@ -0,0 +1,76 @@
+#include <avr/io.h>
+#include "../include/spi.h"
+
+/*
+ * Arduino is split into blocks of pins. Each block needs 3 Registers
+ * DDR (Data Direction Register) - Dictates which pins are Input or output
+ * PORT - Which block of pins is being used.
+ * PIN - Reads input value when a pin is selected as Input mode.
+ */
+
+// Setting up SPI and DDR (Data Direction Register)
+// DDR will decide whether the port is Input (0xFF) or output (Default and 0x00)
+// For example. Setting the fifth bit of DDRB to 1 means we are indicating that
+// we want to use the pin associated to the fifth bit in PORTB to be used as output.
+#define SPI_PORT  PORTB
+#define SPI_DDR   DDRB
+
+// Bits used by the SPI port
+#define MOSI  3
+#define MISO  4
+#define SCK   5
+// Fourth called SS for Slave Select, used for multiple slaves.
+
+// Definition for CS, port, and DDR for the SD Card. - Should match chip?
+#define SD_PORT     PORTB
+#define SD_DDR      DDRB
+#define SD_CS       PORTB2
+#define SD_CS_MASK  (1<<SD_CS)
+
+/*
+ * InitializeSPI function
+ * Sets up CS, MOSI, SCK and MISO pins and enables SPI as master.
+ */
+void InitializeSPI(void) {
+  // First step, enable CS as output.
+  SD_DDR  |= SD_CS_MASK; // Setting the 2nd pin of PORTB (Chip Select) as output via DDRB
+  Deselect(); // Make sure card is not selected.
+
+  SPI_PORT |= ((1<<MOSI) | (1<<SCK));   // Flip bits for MOSI and Serial Clock
+  SPI_DDR  |= ((1<<MOSI) | (1<<SCK));   // Mark pins as output
+  SPI_PORT |= (1<<MISO);                // Flipping MISO bit.
+
+  /*
+   * Enabling SPI via SPCR (Serial Peripheral Control Register)
+   * SPE  - SPI Enable - Flip bit to enable SPI
+   * MSTR - Master/Slave Select. If set Master mode is enabled.
+   * SPR1 - Setting Clock Rate - Multiple options depending on SPX
+   * SPR0 - Setting Clock Rate - SPR0, SPR1 and SPI2X dictate Clock Rate based on which bits are set.
+   * In this configuration Clock Rate is set to fosc/128.
+   */
+  SPCR = (1<<SPE) | (1<<MSTR) | (1<<SPR1) | (1<<SPR0);
+}
+
+/*
+ * Flipping CS bit -- Selecting card.
+ */
+void Select(void) {
+  SD_PORT &= ~SD_CS_MASK;
+}
+
+/*
+ * Flipping CS bit -- De-selecting card.
+ */
+void Deselect(void) {
+  SD_PORT |= SD_CS_MASK;
+}
+
+/*
+ * SendByte function.
+ * ToDo: comment this.
+ */
+uint8_t SendByte(uint8_t c) {
+  SPDR = c; // Write to SPI Data Register - Writes out to MOSI via Hosts SPI Bus
+  while((SPSR & (1<<SPIF)) == 0); // Wait for SPSR and SPIF registers to clear.
+  return SPDR;
+}
@@ -0,0 +1,55 @@
+#include <avr/io.h>
+#include <stdio.h>
+#include "../include/clock.h"
+#include "../include/task.h"
+
+
+static task_t *tasks[TASK_MAX];
+
+
+/*
+ * Schedule a task, first poll straight away. Returns TASK_FAILED if every
+ * slot is taken.
+ */
+uint8_t task_start(task_t *task, task_poll_t poll, uint16_t interval) {
+    uint8_t i;
+
+    for (i = 0; i < TASK_MAX; i++) {
+        if (tasks[i] == NULL) {
+            task->poll     = poll;
+            task->interval = interval;
+            task->started  = clock_ms();
+            task->next     = task->started;
+            task->progress = 0;
+            task->state    = 0;
+            task->result   = TASK_RUNNING;
+            tasks[i] = task;
+            return TASK_RUNNING;
+        }
+    }
+    return TASK_FAILED;
+}
+
+
+/*
+ * Poll every task that is due. Finished tasks leave the table with their
+ * result kept in task->result.
+ */
+void task_run(void) {
+    uint8_t i, result;
+    uint32_t now;
+    task_t *task;
+
+    for (i = 0; i < TASK_MAX; i++) {
+        task = tasks[i];
+        now  = clock_ms();
+        if (task == NULL || (int32_t)(now - task->next) < 0) continue;
+
+        task->next = now + task->interval;
+        result = task->poll(task);
+        if (result != TASK_RUNNING) {
+            task->result = result;
+            tasks[i] = NULL;
+        }
+    }
+}
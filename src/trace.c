@@ -0,0 +1,76 @@
+#include <avr/io.h>
+#include <stdio.h>
+#include <avr/pgmspace.h>
+#include "../include/clock.h"
+#include "../include/trace.h"
+
+#if SD_TRACE
+
+static trace_entry_t ring[TRACE_DEPTH];
+static uint8_t       head;    // next slot to fill
+static uint8_t       count;   // valid entries, up to TRACE_DEPTH
+static uint16_t      lost;    // entries overwritten since the last dump
+
+
+/*
+ * Start a record. Filled in place, only counted once trace_end() commits it.
+ */
+void trace_begin(uint8_t cmd, uint32_t arg) {
+    trace_entry_t *e = &ring[head];
+
+    e->start = clock_us();
+    e->cmd   = cmd;
+    e->arg   = arg;
+    e->busy  = 0;
+}
+
+
+void trace_end(uint8_t r1, uint16_t polls) {
+    trace_entry_t *e = &ring[head];
+
+    e->end   = clock_us();
+    e->r1    = r1;
+    e->polls = polls;
+
+    head = (head + 1) % TRACE_DEPTH;
+    if (count < TRACE_DEPTH) count++;
+    else lost++;
+}
+
+
+/*
+ * Charge data token / busy polling to the most recent command.
+ */
+void trace_busy(uint16_t polls) {
+    trace_entry_t *e;
+
+    if (count == 0) return;
+    e = &ring[(head + TRACE_DEPTH - 1) % TRACE_DEPTH];
+    e->busy += polls;
+    e->end   = clock_us();
+}
+
+
+/*
+ * Print the ring oldest first and empty it.
+ */
+void trace_dump(void) {
+    uint8_t i;
+    trace_entry_t *e;
+
+    printf_P(PSTR("\r\nTRACE %u %lu %02X %02X %u %u\r\n"), TRACE_VERSION,
+             (unsigned long)F_CPU, SPCR, SPSR, count, lost);
+
+    for (i = 0; i < count; i++) {
+        e = &ring[(head + TRACE_DEPTH - count + i) % TRACE_DEPTH];
+        printf_P(PSTR("E %lu %02X %08lX %02X %u %lu %lu\r\n"),
+                 (unsigned long)e->start, e->cmd, (unsigned long)e->arg, e->r1,
+                 e->polls, (unsigned long)e->busy, (unsigned long)(e->end - e->start));
+    }
+    printf_P(PSTR("END\r\n"));
+
+    count = 0;
+    lost  = 0;
+}
+
+#endif /* SD_TRACE */